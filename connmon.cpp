@@ -117,6 +117,19 @@ public:
     uint32_t lastAck{};     // set on RTT sample computation for the stream for which
     uint32_t lastPay{};     //last packet payload (bytes)
     bool revFlow{};             //inidcates if a reverse flow has been seen
+    flowRec* rev{};         //reverse flow's record (null until seen)
+    // incremental throughput, goodput and bytes-in-flight state
+    uint32_t sndNxt{};      //highest seqno (+payload) sent toward dst
+    uint32_t ackHi{};       //highest ackno sent toward dst
+    bool sndValid{};        //sndNxt has been set
+    bool ackValid{};        //ackHi has been set
+    double winStart{};      //capture time current throughput window began
+    double winBytes{};      //bytes on wire sent in current window
+    double winGood{};       //new (not retransmitted) payload bytes in window
+    uint32_t inFlight{};    //sndNxt less highest ackno seen on reverse flow
+    uint32_t lastFlt{};     //inFlight at last throughput report
+    uint32_t lastTSrec{};   //last TSval recorded in tsTbl for this flow
+    bool tsRecValid{};      //lastTSrec has been set
 };
 
 static std::unordered_map<std::string, flowRec*> flows;
@@ -143,6 +156,49 @@ static bool filtLocal = true;
 static std::string filter("tcp");    // default bpf filter
 static int64_t flushInt = 1 << 20;  // stdout flush interval (~uS)
 static int64_t nextFlush;       // next stdout flush time (~uS)
+static double tputInt = 0.;     // per-flow throughput report interval (0=off)
+static uint32_t fltDelta = 0;   // also report if in-flight changes this much
+static bool tputOnly = false;   // print only tput lines, no per-packet lines
+
+// TSval recording policy bits (default 0 records every TSval)
+enum {
+    tsRecData = 1,      // only record TSvals of packets carrying data
+    tsRecNoAck = 2,     // don't record TSvals of pure ACKs
+    tsRecTick = 4       // only record first packet of each TSval tick
+};
+static int tsRec = 0;
+static int tsSkipData, tsSkipAck, tsSkipTick;   // TSvals not recorded
+
+// Decide whether this packet's TSval should go in tsTbl according to the
+// tsRec policy. Called before the key is built so a skipped TSval costs
+// no string construction or hash. tsRecTick skips a repeat of the flow's
+// last recorded TSval, which also keeps an entry that getTStm has just
+// erased from being recreated by later packets of the same tick.
+static inline bool recordTS(flowRec* fr, uint32_t tsval, uint32_t payLen,
+                            uint8_t flags)
+{
+    if (tsRec == 0) {
+        return true;
+    }
+    if ((tsRec & tsRecData) && payLen == 0) {
+        tsSkipData++;
+        return false;
+    }
+    if ((tsRec & tsRecNoAck) && payLen == 0 &&
+        !(flags & (TCP::SYN | TCP::FIN | TCP::RST))) {
+        tsSkipAck++;
+        return false;
+    }
+    if (tsRec & tsRecTick) {
+        if (fr->tsRecValid && tsval == fr->lastTSrec) {
+            tsSkipTick++;
+            return false;
+        }
+        fr->lastTSrec = tsval;
+        fr->tsRecValid = true;
+    }
+    return true;
+}
 
 // save capture time of packet using its flow + TSval as key.  If key
 // exists, don't change it.  The same TSval may appear on multiple
@@ -232,6 +288,25 @@ static std::string fmtTimeDiff(double dt)
     snprintf(buf, sizeof(buf), fmt, dt, SIprefix);
     return buf;
 }
+// format a rate given in bytes/sec as bits/sec with an SI prefix
+static std::string fmtRate(double r)
+{
+    r *= 8.;
+    const char* SIprefix = "";
+    if (r >= 1e9) {
+        r *= 1e-9;
+        SIprefix = "G";
+    } else if (r >= 1e6) {
+        r *= 1e-6;
+        SIprefix = "M";
+    } else if (r >= 1e3) {
+        r *= 1e-3;
+        SIprefix = "k";
+    }
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%.2lf%sbps", r, SIprefix);
+    return buf;
+}
 
 /*
  * return (approximate) time in a 64bit fixed point integer with the
@@ -245,6 +320,86 @@ static int64_t clock_now(void) {
     return (int64_t(tv.tv_sec) << 20) | tv.tv_usec;
 }
 
+static inline void flushIfDue()
+{
+    int64_t now = clock_now();
+    if (now - nextFlush >= 0) {
+        nextFlush = now + flushInt;
+        fflush(stdout);
+    }
+}
+
+static void printTime(std::time_t result)
+{
+    if (machineReadable) {
+        printf("%" PRId64 ".%06d",
+               int64_t(capTm + offTm), int((capTm - floor(capTm)) * 1e6));
+    } else {
+        char tbuff[80];
+        struct tm* ptm = std::localtime(&result);
+        strftime(tbuff, 80, "%T", ptm);
+        printf("%s", tbuff);
+    }
+}
+
+/*
+ * prints a throughput line for the flow's data sender:
+ *  capture time, "tput", throughput (bytes on wire), goodput (payload
+ *  bytes not previously sent), bytes in flight, flowname.
+ * Rates cover the window since the last report that started one (see
+ * reportTput).
+ */
+static void printTput(flowRec* fr, std::time_t result, bool newWin)
+{
+    double dt = capTm - fr->winStart;
+    double thr = dt > 0. ? fr->winBytes / dt : 0.;
+    double gpt = dt > 0. ? fr->winGood / dt : 0.;
+    printTime(result);
+    if (machineReadable) {
+        printf(" tput %.0f %.0f", thr, gpt);
+    } else {
+        printf(" tput %11s %11s", fmtRate(thr).c_str(), fmtRate(gpt).c_str());
+    }
+    printf(" %7u", fr->inFlight);
+    printf(" %s\n", fr->flowname.c_str());
+    fr->lastFlt = fr->inFlight;
+    if (newWin) {
+        fr->winStart = capTm;
+        fr->winBytes = fr->winGood = 0.;
+    }
+    flushIfDue();
+}
+
+// recompute fr's bytes in flight (highest seq sent less the highest ack
+// seen on its reverse flow, modulo 2^32). Returns true if it moved by at
+// least fltDelta since the last report.
+static inline bool updInFlight(flowRec* fr)
+{
+    if (!fr->sndValid || fr->rev == nullptr || !fr->rev->ackValid) {
+        return false;
+    }
+    int32_t d = int32_t(fr->sndNxt - fr->rev->ackHi);
+    fr->inFlight = d > 0 ? uint32_t(d) : 0;
+    if (fltDelta == 0) {
+        return false;
+    }
+    uint32_t chg = fr->inFlight > fr->lastFlt ?
+            fr->inFlight - fr->lastFlt : fr->lastFlt - fr->inFlight;
+    return chg >= fltDelta;
+}
+
+// print at most one throughput line for fr: if its tputInt interval is
+// due that report starts a new window. A threshold report (fltChg) keeps
+// the current window unless there's no interval, in which case rates
+// cover the time since the flow's previous report.
+static inline void reportTput(flowRec* fr, std::time_t result, bool fltChg)
+{
+    bool due = tputInt > 0. && capTm - fr->winStart >= tputInt;
+    if (due || fltChg) {
+        printTput(fr, result, due || tputInt == 0.);
+    }
+}
+
 /*
  * makes sure it's a useful packet, checks for pping
  * computes difference between expected seq number and actual
@@ -273,7 +428,7 @@ void processPacket(const Packet& pkt)
     } else if ((ipv6 = pkt.pdu()->find_pdu<IPv6>()) != nullptr) {
         ipsstr = ipv6->src_addr().to_string();
         ipdstr = ipv6->dst_addr().to_string();
-        payLen = ipv6->payload_length(); //don't need to subtract IP header
+        payLen = ipv6->payload_length() - t_tcp->header_size(); //payload_length excludes IPv6 header
         pktLen = ipv6->payload_length() + ipv6->header_size() + pkt.pdu()->header_size();
     } else {
         not_v4or6++;
@@ -311,6 +466,7 @@ void processPacket(const Packet& pkt)
             return;
         }
         fr = new flowRec(fstr);
+        fr->winStart = capTm;
         flowCnt++;
         flows.emplace(fstr, fr);
         
@@ -318,8 +474,11 @@ void processPacket(const Packet& pkt)
         // of a flow. if this flow is the reverse of a known flow,
         // mark both as bi-directional.
         if (flows.count(dststr + "+" + srcstr) != 0u) {
-            flows.at(dststr + "+" + srcstr)->revFlow = true;
+            flowRec* rr = flows.at(dststr + "+" + srcstr);
+            rr->revFlow = true;
+            rr->rev = fr;
             fr->revFlow = true;
+            fr->rev = rr;
         }
     } else {
         fr = flows.at(fstr);
@@ -348,7 +507,8 @@ void processPacket(const Packet& pkt)
     //pping code
     double prtd=0;
     if(!no_pping) {
-        if (!filtLocal || (localIP != ipdstr)) {
+        if ((!filtLocal || (localIP != ipdstr)) &&
+            recordTS(fr, rcv_tsval, payLen, t_tcp->flags())) {
             addTS(std::to_string(rcv_tsval)+ "+" + fstr, capTm);
         }
         double t = getTStm(std::to_string(rcv_tsecr) + "+" + dststr + "+" + srcstr);
@@ -408,6 +568,48 @@ void processPacket(const Packet& pkt)
     fr->lastTm = capTm;
     fr->lastAck = ackno;
     
+    //throughput, goodput and bytes in flight. Only payload that advances
+    // sndNxt counts toward goodput so retransmissions are excluded.
+    if (tputInt > 0. || fltDelta) {
+        fr->winBytes += (double)pktLen;
+        uint32_t nxt = seqno + payLen;
+        if ((t_tcp->flags() & TCP::SYN) || (t_tcp->flags() & TCP::FIN))
+            nxt++;
+        if (t_tcp->flags() & TCP::SYN) {
+            // new connection (possibly reusing a live 4-tuple): restart
+            // from its ISN rather than comparing against stale seq/acks.
+            // ackHi is re-set below if this is a SYN-ACK.
+            fr->sndNxt = nxt;
+            fr->sndValid = true;
+            fr->ackValid = false;
+            fr->inFlight = fr->lastFlt = 0;
+            fr->winStart = capTm;
+            fr->winBytes = (double)pktLen;
+            fr->winGood = payLen;
+        } else if (!fr->sndValid) {
+            fr->sndNxt = nxt;
+            fr->sndValid = true;
+            fr->winGood += payLen;
+        } else if (int32_t(nxt - fr->sndNxt) > 0) {
+            uint32_t adv = nxt - fr->sndNxt;
+            fr->winGood += adv < payLen ? adv : payLen;
+            fr->sndNxt = nxt;
+        }
+        if (t_tcp->flags() & TCP::ACK) {
+            if (!fr->ackValid || int32_t(ackno - fr->ackHi) > 0) {
+                fr->ackHi = ackno;
+                fr->ackValid = true;
+            }
+            if (fr->rev) {
+                //this ack may free rev's data
+                reportTput(fr->rev, result, updInFlight(fr->rev));
+            }
+        }
+        reportTput(fr, result, updInFlight(fr));
+    }
+    if (tputOnly)
+        return;
+    
     if(!pd && !sd && !ds && !dp)
         return;
     //if only printing rtd vals and aren't any, return
@@ -421,9 +623,8 @@ void processPacket(const Packet& pkt)
      *  number of payload bytes in this packet
      *  number of bytes sent on this flow so far, last is flowname
      */
+    printTime(result);
     if (machineReadable) {
-        printf("%" PRId64 ".%06d",
-               int64_t(capTm + offTm), int((capTm - floor(capTm)) * 1e6));
         if(pd)
             printf(" %8.6f", prtd);
         else
@@ -433,10 +634,6 @@ void processPacket(const Packet& pkt)
         else
             printf("    *    ");
     } else {
-        char tbuff[80];
-        struct tm* ptm = std::localtime(&result);
-        strftime(tbuff, 80, "%T", ptm);
-        printf("%s", tbuff);
         if(pd)
             printf(" %6s", fmtTimeDiff(prtd).c_str());
         else
@@ -451,12 +648,7 @@ void processPacket(const Packet& pkt)
     printf(" %4d", payLen);
     printf(" %7.0f", fr->bytesSnt);
     printf(" %s\n", fstr.c_str());
-    int64_t now = clock_now();
-    if (now - nextFlush >= 0) {
-        nextFlush = now + flushInt;
-        fflush(stdout);
-    }
-
+    flushIfDue();
 }
 
 static void cleanUp(double n)
@@ -481,6 +673,9 @@ static void cleanUp(double n)
     for (auto it = flows.begin(); it != flows.end();) {
         flowRec* fr = it->second;
         if (n - fr->lastTm > flowMaxIdle) {
+            if (fr->rev) {
+                fr->rev->rev = nullptr;
+            }
             delete it->second;
             it = flows.erase(it);
             flowCnt--;
@@ -524,6 +719,9 @@ static void printSummary()
     << pktCnt << " packets, " +
     printnz(no_TS, " no TS opt, ") +
     printnz(uniDir, " uni-directional, ") +
+    printnz(tsSkipData, " TSval not data, ") +
+    printnz(tsSkipAck, " TSval pure ACK, ") +
+    printnz(tsSkipTick, " TSval same tick, ") +
     printnz(not_tcp, " not TCP, ") +
     printnz(not_v4or6, " not v4 or v6, ") +
     "\n";
@@ -544,10 +742,39 @@ static struct option opts[] = {
     { "sumInt",    required_argument, nullptr, 'S' },
     { "rtdMaxAge", required_argument, nullptr, 'M' },
     { "flowMaxIdle", required_argument, nullptr, 'F' },
+    { "tputInt",   required_argument, nullptr, 'T' },
+    { "fltDelta",  required_argument, nullptr, 'D' },
+    { "tputOnly",  no_argument,       nullptr, 'P' },
+    { "tsRec",     required_argument, nullptr, 'R' },
     { "help",      no_argument,       nullptr, 'h' },
     { 0, 0, 0, 0 }
 };
 
+// parse a comma separated --tsRec list into tsRecXXX bits (-1 if invalid)
+static int parseTSRec(const std::string& arg)
+{
+    int bits = 0;
+    size_t b = 0;
+    while (b <= arg.size()) {
+        size_t e = arg.find(',', b);
+        if (e == std::string::npos) {
+            e = arg.size();
+        }
+        std::string p = arg.substr(b, e - b);
+        if (p == "data") {
+            bits |= tsRecData;
+        } else if (p == "noack") {
+            bits |= tsRecNoAck;
+        } else if (p == "tick") {
+            bits |= tsRecTick;
+        } else if (p != "all") {
+            return -1;
+        }
+        b = e + 1;
+    }
+    return bits;
+}
+
 static void usage(const char* pname) {
     std::cerr << "usage: " << pname << " [flags] -i interface | -r pcapFile\n";
 }
@@ -591,6 +818,21 @@ static void help(const char* pname) {
     "\n"
     "  --flowMaxIdle num  flows idle longer than <num> are deleted (default 300s)\n"
     "\n"
+    "  --tputInt num      print a per-flow throughput line (throughput, goodput\n"
+    "                     and bytes in flight) every <num> seconds (default off)\n"
+    "\n"
+    "  --fltDelta num     also print a throughput line when a flow's bytes in\n"
+    "                     flight changes by <num> bytes or more (default off).\n"
+    "                     Without --tputInt, rates are since the flow's last line\n"
+    "\n"
+    "  --tputOnly         print only the throughput lines from --tputInt and/or\n"
+    "                     --fltDelta, not the per-packet lines\n"
+    "\n"
+    "  --tsRec list       which TSvals to record for RTD matching; a comma\n"
+    "                     separated list of: data (only packets with payload),\n"
+    "                     noack (skip pure ACKs), tick (only first packet of\n"
+    "                     each TSval tick) or all (the default).\n"
+    "\n"
     "  -h|--help          print help then exit\n"
     ;
 }
@@ -619,6 +861,15 @@ int main(int argc, char* const* argv)
             case 'S': sumInt = atof(optarg); break;
             case 'M': rtdMaxAge = atof(optarg); break;
             case 'F': flowMaxIdle = atof(optarg); break;
+            case 'T': tputInt = atof(optarg); break;
+            case 'D': fltDelta = strtoul(optarg, nullptr, 10); break;
+            case 'P': tputOnly = true; break;
+            case 'R':
+                if ((tsRec = parseTSRec(optarg)) < 0) {
+                    std::cerr << "bad --tsRec list: " << optarg << "\n";
+                    exit(1);
+                }
+                break;
             case 'h': help(argv[0]); exit(0);
         }
     }
@@ -626,6 +877,10 @@ int main(int argc, char* const* argv)
         usage(argv[0]);
         exit(1);
     }
+    if (tputOnly && tputInt <= 0. && fltDelta == 0) {
+        std::cerr << "--tputOnly needs --tputInt and/or --fltDelta\n";
+        exit(1);
+    }
     
     BaseSniffer* snif;
     {
@@ -678,6 +933,9 @@ int main(int argc, char* const* argv)
                 pktCnt = 0;
                 no_TS = 0;
                 uniDir = 0;
+                tsSkipData = 0;
+                tsSkipAck = 0;
+                tsSkipTick = 0;
                 not_tcp = 0;
                 not_v4or6 = 0;
             }